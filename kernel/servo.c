@@ -11,6 +11,10 @@
 #include <linux/pwm.h>
 #include <linux/errno.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h> /* vmalloc_user */
+#include <linux/mm.h> /* remap_vmalloc_range */
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
 
 /* ------------------------------------------------------------------------- */
 /* Custom headers */
@@ -63,7 +67,9 @@ struct servo_driver_data {
     struct class *cl;
     struct device *dev;
     struct pwm_device* servos[TOTAL_NODES];
-    struct pwm_state* states[TOTAL_NODES];
+    struct pwm_state states[TOTAL_NODES]; /* last commanded, outlives any one open() */
+    struct servo_telem_hdr *telem; /* mmap-able, see servo.h */
+    spinlock_t telem_lock; /* keeps the ring single-producer */
 };
 
 
@@ -74,6 +80,48 @@ struct servo_driver_data {
 /* ------------------------------------------------------------------------- */
 /* Function definitions */
 /* ------------------------------------------------------------------------- */
+static inline struct servo_telem_rec *servo_telem_recs(
+    struct servo_telem_hdr *hdr)
+{
+    return (struct servo_telem_rec *)((char *)hdr + SERVO_TELEM_HDR_SIZE);
+}
+
+/* Append what was just applied to a joint to the telemetry ring.
+ * Readers never take the lock, they only look at head. */
+static void servo_telem_log(
+    int index,
+    enum servo_telem_op op,
+    int result)
+{
+    struct servo_telem_hdr *hdr = global_data->telem;
+    struct servo_telem_rec *rec;
+    struct pwm_state applied;
+    u32 head;
+
+    if (!hdr || index < 0 || index >= TOTAL_NODES || !global_data->servos[index]) {
+        return;
+    }
+
+    /* states[] is only staged until the next sync; the PWM core's copy is
+     * what pwm_config() last actually took */
+    pwm_get_state(global_data->servos[index], &applied);
+
+    spin_lock(&global_data->telem_lock);
+    head = hdr->head;
+    rec = &servo_telem_recs(hdr)[head & (SERVO_TELEM_NRECS - 1)];
+    rec->ts_ns = ktime_get_ns();
+    rec->duty_ns = applied.duty_cycle;
+    rec->result = result;
+    rec->idx = index;
+    rec->enabled = applied.enabled;
+    rec->op = op;
+    /* publish the record, then make sure the next record's stores can't
+     * be seen before this head (same ordering as a seqlock writer) */
+    smp_store_release(&hdr->head, head + 1);
+    smp_wmb();
+    spin_unlock(&global_data->telem_lock);
+}
+
 /* Gets called once to configure a new axis */
 /* Returns positive ID or negative errno */
 static int store_servo_info(
@@ -84,11 +132,8 @@ static int store_servo_info(
 
     for (idx = 0; idx < TOTAL_NODES; idx++) {
         if (0 == strcmp(joints[idx], label)) {
-            global_data->states[idx] = kzalloc(sizeof(struct pwm_state), GFP_KERNEL); /* TODO: This leaks */
-            if (NULL == global_data->states[idx]) {
-                return -ENOMEM;
-            }
-            memcpy(global_data->states[idx], &pwm->state, sizeof(struct pwm_state));
+            /* Start from whatever the hardware is already doing */
+            pwm_get_state(pwm, &global_data->states[idx]);
             global_data->servos[idx] = pwm;
             return idx;
         }
@@ -139,8 +184,11 @@ static int servo_probe(
     if (0 > (id = store_servo_info(pwm->label, pwm))) {
         pr("was not expecting node %s", pwm->label);
     } else {
-        pr_dbg("assigned %s to slot %d", pwm->label, id);
-        pwm_disable(pwm);
+        /* Don't disable: if the controller or module was restarted the
+         * chip is still holding the arm where it was */
+        pr_dbg("assigned %s to slot %d (duty %u, %s)", pwm->label, id,
+                global_data->states[id].duty_cycle,
+                global_data->states[id].enabled ? "enabled" : "disabled");
     }
 
 
@@ -175,14 +223,14 @@ static int servo_set_duty_ns(
     int index,
     int duty)
 {
-    global_data->states[index]->duty_cycle = duty;
+    global_data->states[index].duty_cycle = duty;
     return 0;
 }
 static int servo_get_duty_ns(
     unsigned char index,
     int* duty)
 {
-    *duty = global_data->states[index]->duty_cycle;
+    *duty = global_data->states[index].duty_cycle;
     pr_dbg("got index=%d duty=%d", index, *duty);
     return 0;
 }
@@ -192,11 +240,92 @@ static int servo_sync(
 {
     return pwm_config(
             global_data->servos[index],
-            global_data->states[index]->duty_cycle,
+            global_data->states[index].duty_cycle,
             SERVO_PWM_PERIOD);
 }
 
 
+static void servo_snapshot(
+    struct servo_snapshot *snap)
+{
+    int idx;
+
+    memset(snap, 0, sizeof(*snap));
+    snap->magic = SERVO_SNAPSHOT_MAGIC;
+    snap->version = SERVO_SNAPSHOT_VERSION;
+    for (idx = 0; idx < TOTAL_NODES; idx++) {
+        if (!global_data->servos[idx]) {
+            continue;
+        }
+        snap->joint[idx].present = 1;
+        snap->joint[idx].duty_ns = global_data->states[idx].duty_cycle;
+        snap->joint[idx].enabled = pwm_is_enabled(global_data->servos[idx]);
+    }
+}
+
+/* Put every joint named in snap back where it was.
+ * Returns 0 or the first error, but tries every joint regardless. */
+static int servo_restore(
+    const struct servo_snapshot *snap)
+{
+    int idx;
+    int ret = 0;
+    int err;
+
+    if (snap->magic != SERVO_SNAPSHOT_MAGIC || snap->version != SERVO_SNAPSHOT_VERSION) {
+        prerr("bad snapshot magic %08x version %u", snap->magic, snap->version);
+        return -EINVAL;
+    }
+
+    for (idx = 0; idx < TOTAL_NODES; idx++) {
+        if (!snap->joint[idx].present || !global_data->servos[idx]) {
+            continue;
+        }
+
+        servo_set_duty_ns(idx, snap->joint[idx].duty_ns);
+        if (0 != (err = servo_sync(idx))) {
+            prerr("error %d restoring servo %d", err, idx);
+        } else if (snap->joint[idx].enabled) {
+            err = pwm_enable(global_data->servos[idx]);
+        } else {
+            pwm_disable(global_data->servos[idx]);
+        }
+        servo_telem_log(idx, SERVO_TELEM_RESTORE, err);
+
+        if (!ret) {
+            ret = err;
+        }
+    }
+
+    return ret;
+}
+
+/* Snapshot and restore don't use servo_ioctl_pkt */
+static long servo_ioctl_snapshot(
+    unsigned int num,
+    unsigned long param)
+{
+    struct servo_snapshot snap;
+    int ret = 0;
+
+    if (num == SERVO_IOC_SNAPSHOT) {
+        servo_snapshot(&snap);
+        if (0 != copy_to_user((void __user *) param, &snap, sizeof(snap))) {
+            prerr("snapshot was not copied out of kernel");
+            ret = -EFAULT;
+        }
+    } else {
+        if (0 != copy_from_user(&snap, (void __user *) param, sizeof(snap))) {
+            prerr("snapshot was not copied into kernel");
+            ret = -EFAULT;
+        } else if (0 != (ret = servo_restore(&snap))) {
+            prerr("error %d restoring snapshot", ret);
+        }
+    }
+
+    return ret;
+}
+
 static long servo_ioctl(
     struct file *file,
     unsigned int num,/* The number of the ioctl */
@@ -204,6 +333,11 @@ static long servo_ioctl(
 {
     int ret = 0;
     struct servo_ioctl_pkt pkt;
+
+    if (num == SERVO_IOC_SNAPSHOT || num == SERVO_IOC_RESTORE) {
+        return servo_ioctl_snapshot(num, param);
+    }
+
     memset(&pkt, 0, sizeof(pkt));
     if (0 != (ret = copy_from_user(&pkt, (void __user *) param, sizeof(pkt)))) {
         if (ret > 0) {
@@ -234,18 +368,22 @@ static long servo_ioctl(
                 } else {
                     pr_dbg("id: %d duty: %d", pkt.idx, pkt.duty_ns);
                 }
+                break;
             case SERVO_IOC_ENABLE:
                 if (0 != (ret = pwm_enable( global_data->servos[pkt.idx]))) {
                     prerr("error %d enabling servo %d", ret, pkt.idx);
                 }
+                servo_telem_log(pkt.idx, SERVO_TELEM_ENABLE, ret);
                 break;
             case SERVO_IOC_DISABLE:
                 pwm_disable(global_data->servos[pkt.idx]);
+                servo_telem_log(pkt.idx, SERVO_TELEM_DISABLE, 0);
                 break;
             case SERVO_IOC_SYNC:
                 if (0 != (ret = servo_sync(pkt.idx))) {
                     prerr("Error %d trying to synchronize\n", ret);
                 }
+                servo_telem_log(pkt.idx, SERVO_TELEM_SYNC, ret);
                 break;
 
             default:
@@ -256,8 +394,22 @@ static long servo_ioctl(
     return ret;
 }
 
+/* Only the telemetry ring can be mapped, and only for reading */
+static int servo_mmap(
+    struct file *file,
+    struct vm_area_struct *vma)
+{
+    if (vma->vm_flags & VM_WRITE) {
+        return -EPERM;
+    }
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    return remap_vmalloc_range(vma, global_data->telem, vma->vm_pgoff);
+}
+
 struct file_operations fops = {
     .unlocked_ioctl = servo_ioctl,
+    .mmap = servo_mmap,
 };
 
 static int __init servo_init(
@@ -266,6 +418,8 @@ static int __init servo_init(
      /* stack alloc */
     int ret; /* unused */
 
+    BUILD_BUG_ON(TOTAL_NODES > SERVO_MAX_JOINTS);
+
     /* dynamic alloc */
     pr("Attempting to inititalize driver");
     if (NULL == (global_data = kzalloc(sizeof(struct servo_driver_data ), GFP_KERNEL))) {
@@ -274,6 +428,17 @@ static int __init servo_init(
     }
     pr("allocated memory for driver struct");
 
+    /* Telemetry ring (zeroed, so head starts at 0) */
+    if (NULL == (global_data->telem = vmalloc_user(SERVO_TELEM_MAP_SIZE))) {
+        prerr("Couldn't allocate telemetry ring");
+        goto err_telem_alloc;
+    }
+    global_data->telem->magic = SERVO_TELEM_MAGIC;
+    global_data->telem->version = SERVO_TELEM_VERSION;
+    global_data->telem->rec_size = sizeof(struct servo_telem_rec);
+    global_data->telem->nrecs = SERVO_TELEM_NRECS;
+    spin_lock_init(&global_data->telem_lock);
+
     /* Register the character device (atleast try) */
     ret = register_chrdev(SERVO_MAJ, SERVO_DEVICE_NAME,
                                  &fops);
@@ -329,6 +494,10 @@ err_class_create:
     unregister_chrdev(global_data->major, SERVO_DEVICE_NAME);
 
 err_reg_char:
+    pr_dbg("freeing telemetry ring");
+    vfree(global_data->telem);
+
+err_telem_alloc:
     pr_dbg("freeing memory");
     kfree(global_data);
 
@@ -350,6 +519,7 @@ static void __exit servo_exit(
     pr_dbg("unregistering character device");
     unregister_chrdev(global_data->major, SERVO_DEVICE_NAME);
 
+    vfree(global_data->telem);
     kfree(global_data);
     pr_dbg("freed global data");
     return;
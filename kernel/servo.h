@@ -1,6 +1,8 @@
 #ifndef SERVO_H
 #define SERVO_H
 
+#include <linux/types.h>
+
 #define SERVO_DEVICE_NAME "robot"
 #define SERVO_DRIVER_NAME "servo"
 
@@ -13,6 +15,8 @@
 #define SERVO_IOC_ENABLE _IOW(SERVO_IOC_MAGIC, 3, int)
 #define SERVO_IOC_DISABLE _IOW(SERVO_IOC_MAGIC, 4, int)
 #define SERVO_IOC_SYNC _IO(SERVO_IOC_MAGIC, 5)
+#define SERVO_IOC_SNAPSHOT _IOR(SERVO_IOC_MAGIC, 6, struct servo_snapshot)
+#define SERVO_IOC_RESTORE _IOW(SERVO_IOC_MAGIC, 7, struct servo_snapshot)
 #define SERVO_IOC_MAX 8
 
 #define SERVO_MAJ 0
@@ -20,6 +24,49 @@
 #define SERVO_CLASS_NAME "servo"
 
 #define SERVO_PWM_PERIOD 20000000
+#define SERVO_PWM_COUNTS 4096 /* PCA9685 resolution over one period */
+
+#define SERVO_MAX_JOINTS 6
+
+/* Telemetry ring, mapped read-only from /dev/robot at offset 0.
+ * The header occupies the first SERVO_TELEM_HDR_SIZE bytes and is
+ * followed by SERVO_TELEM_NRECS records. The driver is the only
+ * producer; readers load head (acquire), copy records out, then re-load
+ * head to discard any record that was overwritten while copying. */
+#define SERVO_TELEM_MAGIC 0x534d4c54 /* "TLMS" */
+#define SERVO_TELEM_VERSION 1
+#define SERVO_TELEM_HDR_SIZE 4096
+#define SERVO_TELEM_NRECS 4096 /* must be a power of two */
+#define SERVO_TELEM_MAP_SIZE (SERVO_TELEM_HDR_SIZE + \
+        SERVO_TELEM_NRECS * sizeof(struct servo_telem_rec))
+
+/* What happened to a joint */
+enum servo_telem_op {
+    SERVO_TELEM_SYNC = 0,
+    SERVO_TELEM_ENABLE = 1,
+    SERVO_TELEM_DISABLE = 2,
+    SERVO_TELEM_RESTORE = 3,
+};
+
+struct servo_telem_hdr {
+    __u32 magic;
+    __u32 version;
+    __u32 rec_size;
+    __u32 nrecs;
+    __u32 head; /* records ever written (wraps), only the driver writes this */
+    __u32 pad;
+};
+
+/* One applied setting, timestamped with CLOCK_MONOTONIC */
+struct servo_telem_rec {
+    __u64 ts_ns;
+    __s32 duty_ns;
+    __s32 result; /* return of pwm_config()/pwm_enable() */
+    __u8 idx;
+    __u8 enabled;
+    __u8 op;
+    __u8 pad[5];
+};
 
 /* What we want to receive from user space */
 struct servo_ioctl_pkt {
@@ -28,4 +75,23 @@ struct servo_ioctl_pkt {
     bool enabled;
 };
 
+/* Everything the driver knows about every joint, in one ioctl.
+ * Also the format of the blob saved across module reloads, so
+ * SERVO_IOC_RESTORE checks magic and version. */
+#define SERVO_SNAPSHOT_MAGIC 0x504e5353 /* "SSNP" */
+#define SERVO_SNAPSHOT_VERSION 1
+
+struct servo_joint_state {
+    __s32 duty_ns;
+    __u8 present; /* probed from the device tree */
+    __u8 enabled;
+    __u8 pad[2];
+};
+
+struct servo_snapshot {
+    __u32 magic;
+    __u32 version;
+    struct servo_joint_state joint[SERVO_MAX_JOINTS];
+};
+
 #endif /* SERVO_H */
@@ -0,0 +1,545 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h> /* struct timespec and nanosleep */
+#include <assert.h>
+
+#include "arm.h"
+#include "cspace.h"
+
+#define DRY_RUN
+//#define DEBUG_PRINT
+
+FILE *arm_record;
+
+/* How closely SWEEP_EVENT pins down when a count changes */
+#define EVENT_RESOLUTION_NS 1000
+
+/* How finely path_limit() looks for a path function's steepest point */
+#define PATH_SHAPE_SAMPLES 256
+
+const node_t node_defaults[NUM_JOINTS] = {
+                    { .index = 0, .min_duty = 600000,  .max_duty = 2400000, .duty = 0, .duty_default = 600000, .a = 10000,  .b = 0, .model = MODEL_DEFAULT, .sim_model = MODEL_DEFAULT },
+                    { .index = 1, .min_duty = 600000,  .max_duty = 2600000, .duty = 0, .duty_default = 1700000, .a = 10000,  .b = 0, .model = MODEL_DEFAULT, .sim_model = MODEL_DEFAULT },
+                    { .index = 2, .min_duty = 600000,  .max_duty = 2400000, .duty = 0, .duty_default = 800000, .a = 10000,  .b = 0, .model = MODEL_DEFAULT, .sim_model = MODEL_DEFAULT },
+                    { .index = 3, .min_duty = 600000,  .max_duty = 2400000, .duty = 0, .duty_default = 2000000, .a = 10000,  .b = 0, .model = MODEL_DEFAULT, .sim_model = MODEL_DEFAULT },
+                    { .index = 4, .min_duty = 600000,  .max_duty = 2400000, .duty = 0, .duty_default = 1400000, .a = 10000,  .b = 0, .model = MODEL_DEFAULT, .sim_model = MODEL_DEFAULT },
+                    { .index = 5, .min_duty = 1800000, .max_duty = 2400000, .duty = 0, .duty_default = 1800000, .a = 10000,  .b = 0, .model = MODEL_DEFAULT, .sim_model = MODEL_DEFAULT }};
+
+/* --------------------------------------------------*/
+/* Function definitions */
+/* --------------------------------------------------*/
+float gentle(float in)
+{
+    return logf(in);
+}
+
+float euler_poisson(float x)
+{
+    float two_x = 2*x;
+    return 1-expf(-two_x*two_x);
+}
+
+float gentle2(float x)
+{
+    float s = sinf(8*x/5);
+    return s*s;
+}
+
+/* Where a path puts its joint at a given progress */
+int path_duty(const path_t* path, float progress)
+{
+    int base = path->start_duty;
+    int delta = path->target_duty - path->start_duty;
+    int step = 0;
+
+    if (!path->path_func) {
+        step = delta * progress;
+    } else {
+        step = delta * path->path_func(progress);
+    }
+    return base + step;
+}
+
+/* What gets sent for a path at a given progress */
+int path_command(const node_t* node, float progress)
+{
+    const path_t *path = node->path;
+
+    /* Lead the plan by the servo's dead time so the horn, not the
+     * command, follows the profile */
+    float lead = progress + path->progress_unit * node->model.dead_ns;
+
+    if (lead >= 1.0f) {
+        return path->target_duty;
+    }
+    return path_duty(path, lead);
+}
+
+int calc_next_duty(node_t* node)
+{
+    if (!node || !node->path) {
+        return -EINVAL;
+    }
+
+    node->duty = path_command(node, node->path->progress);
+    if (node->path->progress >= 1.0f) {
+        node->path->done = true;
+    }
+    return 0;
+}
+
+/* What the PCA9685 will actually output for duty, after set_duty()'s clamp.
+ * Mirrors pca9685_pwm_config() in the 4.9 drivers/pwm/pwm-pca9685.c:
+ * counts are DIV_ROUND_UP, under 1 ns is full off and exactly one period
+ * is full on. */
+int duty_counts(const node_t* node, int duty)
+{
+    if (duty > node->max_duty) duty = node->max_duty;
+    if (duty < node->min_duty) duty = node->min_duty;
+    if (duty < 1) return 0;
+    if (duty == SERVO_PWM_PERIOD) return SERVO_PWM_COUNTS;
+    return ((long long)SERVO_PWM_COUNTS * duty + SERVO_PWM_PERIOD - 1) / SERVO_PWM_PERIOD;
+}
+
+/* The duty the horn really sees for a commanded duty */
+int output_duty(const node_t* node, int duty)
+{
+    return (long long)duty_counts(node, duty) * SERVO_PWM_PERIOD / SERVO_PWM_COUNTS;
+}
+
+int set_duty(int fd, node_t* node)
+{
+    if (node->duty > node->max_duty) node->duty = node->max_duty;
+    if (node->duty < node->min_duty) node->duty = node->min_duty;
+    struct servo_ioctl_pkt pkt;
+#ifdef DEBUG_PRINT
+    pr("node %d: duty = %d ", node->index, node->duty);
+#endif
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.idx = node->index;
+    pkt.duty_ns = node->duty;
+#ifndef DRY_RUN
+    if (0 != (ioctl(fd, SERVO_IOC_SET_DUTY_NS, &pkt))) {
+        pr("Error %d calling set ioctl: %s", errno, strerror(errno));
+        return -errno;
+    }
+#endif
+    return 0;
+}
+
+int get_snapshot(int fd, struct servo_snapshot* snap)
+{
+    memset(snap, 0, sizeof(*snap));
+#ifndef DRY_RUN
+    if (0 != (ioctl(fd, SERVO_IOC_SNAPSHOT, snap))) {
+        return -errno;
+    }
+#endif
+    return 0;
+}
+
+/* Warm start: one ioctl for the whole arm instead of one per node.
+ * Joints the driver has never been told about get their defaults. */
+int init_nodes(int fd, node_t* nodes, int count)
+{
+    if (!nodes) return -EINVAL;
+
+    int ret = 0;
+    struct servo_snapshot snap;
+
+    if (0 != (ret = get_snapshot(fd, &snap))) {
+        pr("Error %d getting snapshot: %s", ret, strerror(-ret));
+        return ret;
+    }
+
+    for (int i = 0; i < count; i++) {
+        node_t *node = &nodes[i];
+
+        if (node->index >= 0 && node->index < SERVO_MAX_JOINTS &&
+                snap.joint[node->index].present) {
+            node->duty = snap.joint[node->index].duty_ns;
+        }
+        if (node->duty == 0) {
+            node->duty = node->duty_default;
+        }
+    }
+
+    return 0;
+}
+
+/* Give the DRY_RUN arm its own response, read from the file named by
+ * MODEL_SIM_ENV; without one it is MODEL_DEFAULT */
+int sim_load(node_t* nodes, int count)
+{
+#ifdef DRY_RUN
+    const char *path = getenv(MODEL_SIM_ENV);
+    int ret;
+
+    if (path && 0 != (ret = model_load_sim(path, nodes, count))) {
+        pr("Error %d loading %s: %s", -ret, path, strerror(-ret));
+        return ret;
+    }
+#endif
+    return 0;
+}
+
+int servo_sync(int fd, node_t* node)
+{
+    struct servo_ioctl_pkt pkt;
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.idx = node->index;
+
+#ifndef DRY_RUN
+    if (0 != (ioctl(fd, SERVO_IOC_SYNC, &pkt))) {
+        return -errno;
+    }
+#endif
+    return 0;
+
+
+}
+
+int sepath_t(
+        path_t** pPath,
+        int start_duty,
+        int duty_goal)
+{
+    if (!pPath) return -EINVAL;
+    path_t *path = NULL;
+    if (NULL == (path = calloc(1, sizeof(path_t)))) {
+        pr( "couldn't allocate memory for path struct");
+        return -ENOMEM;
+    }
+
+    path->start_duty = start_duty;
+    path->target_duty = duty_goal;
+
+    float duration = fabs((float)(duty_goal - start_duty)) * 1600;
+    if (duration < 1) duration = 1;
+    path->progress_unit = 1.0f / duration;
+
+    path->path_func = gentle2;
+
+    *pPath = path;
+
+    return 0;
+}
+
+static float path_shape(
+        const path_t* path,
+        float x)
+{
+    return path->path_func ? path->path_func(x) : x;
+}
+
+/* Stretch a path until its fastest point is within the servo's max_rate
+ * and max_accel, so the horn can track it instead of falling behind and
+ * overshooting. Returns true if the path had to be slowed down. */
+bool path_limit(
+        path_t* path,
+        const servo_model_t* model)
+{
+    float delta = fabsf((float)(path->target_duty - path->start_duty));
+    float dx = 1.0f / PATH_SHAPE_SAMPLES;
+    float slope = 0;
+    float bend = 0;
+
+    if (delta == 0) return false;
+
+    for (int i = 0; i < PATH_SHAPE_SAMPLES; i++) {
+        float f0 = path_shape(path, i * dx);
+        float f1 = path_shape(path, (i + 1) * dx);
+        slope = fmaxf(slope, fabsf(f1 - f0) / dx);
+
+        if (i + 1 < PATH_SHAPE_SAMPLES) {
+            float f2 = path_shape(path, (i + 2) * dx);
+            bend = fmaxf(bend, fabsf(f2 - 2 * f1 + f0) / (dx * dx));
+        }
+    }
+
+    /* Peak speed is delta * slope * unit and peak acceleration
+     * delta * bend * unit^2, with unit per ns and the limits per s */
+    float unit = path->progress_unit;
+    if (slope > 0) {
+        unit = fminf(unit, model->max_rate / 1E9f / (delta * slope));
+    }
+    if (bend > 0) {
+        unit = fminf(unit, sqrtf(model->max_accel / 1E18f / (delta * bend)));
+    }
+    if (unit >= path->progress_unit) return false;
+
+    path->progress_unit = unit;
+    return true;
+}
+
+float clock_delta(
+        struct timespec t1,
+        struct timespec t2)
+{
+    int d_s = t2.tv_sec - t1.tv_sec;
+    int d_ns = t2.tv_nsec - t1.tv_nsec;
+    return d_s ? d_s * 1E9 + d_ns : d_ns;
+}
+
+int get_max_delta(
+        node_t* nodes[6],
+        int* pMaxDelta)
+{
+    if (!nodes) return -EINVAL;
+
+    int max_delta = 0;
+
+    for (int i = 0; i < 6; i++)
+    {
+        if (!nodes[i]->path) continue;
+
+        int delta = (nodes[i]->path->target_duty - nodes[i]->path->start_duty);
+
+        if (delta > max_delta) max_delta = delta;
+
+    }
+    *pMaxDelta = max_delta;
+    return 0;
+}
+
+void drop_paths(node_t *nodes[6])
+{
+    for (int n = 0; n < 6; n++) {
+        if (!nodes[n] || !nodes[n]->path) continue;
+        free(nodes[n]->path);
+        nodes[n]->path = NULL;
+    }
+}
+
+/* ns from now until the count node's joint outputs changes, or its path
+ * ends. Searches forward in doubling steps of at most one PWM period (the
+ * chip can't show anything shorter) and then bisects. */
+float next_change_ns(const node_t *node)
+{
+    const path_t *path = node->path;
+    int counts = duty_counts(node, path_command(node, path->progress));
+    float end = (1.0f - path->progress) / path->progress_unit;
+    float lo = 0;
+    float hi = EVENT_RESOLUTION_NS;
+
+    if (end <= 0) return 0;
+
+    for (;;) {
+        if (hi >= end) return end;
+        if (counts != duty_counts(node, path_command(node,
+                        path->progress + path->progress_unit * hi))) break;
+        lo = hi;
+        hi += hi < SERVO_PWM_PERIOD ? hi : SERVO_PWM_PERIOD;
+    }
+
+    while (hi - lo > EVENT_RESOLUTION_NS) {
+        float mid = (lo + hi) / 2;
+        if (counts != duty_counts(node, path_command(node,
+                        path->progress + path->progress_unit * mid))) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    return hi;
+}
+
+/* Sleep until the earliest joint's output changes */
+void sleep_until_change(
+        node_t *nodes[6],
+        struct timespec start_time,
+        double elapsed)
+{
+    float next = -1;
+
+    for (int n = 0; n < NUM_JOINTS; n++) {
+        if (!nodes[n] || !nodes[n]->path) continue;
+        float t = next_change_ns(nodes[n]);
+        if (next < 0 || t < next) next = t;
+    }
+    if (next <= 0) return;
+
+    long long wake = start_time.tv_nsec + (long long)(elapsed + next);
+    struct timespec ts = {
+        .tv_sec = start_time.tv_sec + wake / 1000000000LL,
+        .tv_nsec = wake % 1000000000LL,
+    };
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+}
+
+/* cspace may be NULL to skip collision checks */
+int multi_sweep(int fd, node_t *nodes[6], int duty_end[6],
+        const struct cspace *cspace, sweep_sched_t sched)
+{
+    int ret = 0;
+    for (int n = 0; n < NUM_JOINTS; n++) {
+        node_t *node = nodes[n];
+        if (!node) continue;
+
+        if (node->duty == 0) {
+            node->duty = node->duty_default;
+        }
+        pr("%d: duty_start = %d duty_end = %d",
+                n, node->duty, duty_end[n]);
+        model_reset(&node->est, output_duty(node, node->duty));
+        model_reset(&node->sim, output_duty(node, node->duty));
+        node->last_duty = node->duty;
+
+        if (0 != (ret = sepath_t(&node->path, node->duty, duty_end[n]))) {
+            pr( "error %d calculating params: %s",
+                    ret, strerror(-ret));
+            return ret;
+        }
+        if (path_limit(node->path, &node->model)) {
+            pr("%d: slowed to %.1f ms to stay within the servo's limits",
+                    n, 1E-6f / node->path->progress_unit);
+        }
+    }
+
+    /* Refuse the whole move up front rather than stopping halfway */
+    if (cspace && 0 != (ret = cspace_check_path(cspace, nodes))) {
+        pr("refusing move: %s", strerror(-ret));
+        drop_paths(nodes);
+        return ret;
+    }
+
+    int step_count = 0;
+    int update_count = 0;
+    double elapsed = 0;
+    struct timespec start_time, end_time, last;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    TIMESPEC_COPY(last, start_time);
+    
+    do {
+        /* Loop Sync */
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        float tick = clock_delta(last, end_time);
+        //pr("%d: %.2f us: progress = %.2f", step_count, tick / 1E3, node->path->progress);
+        TIMESPEC_COPY(last, end_time);
+        step_count++;
+        elapsed += tick;
+
+        /* Calculate new duty based on progress and path function */
+        for (int n = 0; n < NUM_JOINTS; n++) {
+            node_t *node = nodes[n];
+            if (!node || !node->path) continue;
+
+            node->path->progress += node->path->progress_unit * tick;
+            calc_next_duty(node);
+        }
+
+        /* Check what is about to be sent, in case the plan and the loop
+         * disagree */
+        if (cspace) {
+            int duty[6];
+            for (int n = 0; n < 6; n++) {
+                duty[n] = nodes[n] ? nodes[n]->duty : 0;
+            }
+            if (cspace_blocked(cspace, duty)) {
+                pr("setpoint blocked, stopping");
+                drop_paths(nodes);
+                ret = -EDOM;
+                break;
+            }
+        }
+
+        for (int n = 0; n < NUM_JOINTS; n++) 
+        {
+            /* per node */
+            node_t *node = nodes[n];
+            if (!node) continue;
+
+            /* When sleeping between events only send what the PCA9685
+             * would actually output differently */
+            if (node->path && (sched != SWEEP_EVENT || node->path->done ||
+                        duty_counts(node, node->duty) != duty_counts(node, node->last_duty))) {
+                /* Apply new duty to node and update kernel */
+                /* TODO: Should not need to context switch once per node
+                 * but that's how the driver is currently written */
+                if (0 != (ret = set_duty(fd, node))) {
+                    pr( "Error %d setting duty %d for id %d: %s",
+                            ret, node->duty, node->index, strerror(-ret));
+                    break;
+                } else if (0 != (ret = servo_sync(fd, node))) {
+                    pr( "Error %d syncing for id %d: %s",
+                            ret, node->index, strerror(-ret));
+                    break;
+                }
+                update_count++;
+
+                /* Debug tracking */
+                node->last_duty = node->duty;
+                node->path->last_progress = node->path->progress;
+#if 0
+
+                 pr( "duty = %d goal = %d progress = %.5f",
+                          node->duty, node->path->target_duty, node->path->progress);
+                 assert(node->path->target_duty > 0);
+
+                 pr( "diff duty = %d, progress = %.5f, duty/time = %f",
+                         node->duty - node->last_duty,
+                         node->path->progress - node->path->last_progress,
+                         (node->duty - node->last_duty) *1E6 / tick);
+
+#endif
+            }
+
+            /* The target has been sent once the path is done */
+            if (node->path && node->path->done) {
+                free(node->path);
+                node->path = NULL;
+            }
+
+            /* Where the horn should be by now, and under DRY_RUN where the
+             * simulated one really is */
+            int out = output_duty(node, node->last_duty);
+            model_step(&node->model, &node->est, out, tick);
+#ifdef DRY_RUN
+            model_step(&node->sim_model, &node->sim, out, tick);
+            float pos = node->sim.pos;
+#else
+            float pos = node->est.pos;
+#endif
+            if (arm_record) {
+                fprintf(arm_record, "%.0f %d %d %.0f\n",
+                        elapsed, node->index, out, pos);
+            }
+        }
+
+        if (sched == SWEEP_EVENT) {
+            sleep_until_change(nodes, start_time, elapsed);
+        }
+
+    } while (nodes[0]->path || nodes[1]->path ||
+                nodes[2]->path || nodes[3]->path ||
+                nodes[4]->path || nodes[5]->path);
+    //} while (abs(node->path->target_duty - node->duty) > 100);
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    float duration = clock_delta(start_time, end_time);
+    float step_duration = duration / step_count;
+    int maxDelta = 0;
+    get_max_delta(nodes, &maxDelta);
+    float ns_per_duty = duration / maxDelta;
+    pr("took %d steps in %.2f ms (%.2f ms/step), ns_per_duty = %f", 
+            step_count, duration / 1E6, step_duration / 1E6, ns_per_duty);
+    pr("sent %d updates", update_count);
+
+    float settle = 0;
+    for (int n = 0; n < NUM_JOINTS; n++) {
+        if (!nodes[n]) continue;
+        float t = model_settle_ns(&nodes[n]->model, &nodes[n]->est,
+                output_duty(nodes[n], nodes[n]->duty));
+        if (t > settle) settle = t;
+    }
+    pr("predicted to settle %.2f ms after the last command", settle / 1E6);
+
+    return ret;
+}
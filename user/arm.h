@@ -0,0 +1,95 @@
+#ifndef ARM_H
+#define ARM_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h> /* struct timespec */
+
+#include "../kernel/servo.h"
+#include "model.h"
+
+#define DEF_DUTY 900000
+
+#define NUM_JOINTS 6
+
+#define pr(fmt, ...) fprintf(stderr, "<%s:%d> " fmt "\n", __func__, __LINE__, ##__VA_ARGS__)
+
+#define TIMESPEC_COPY(dest,src) do { \
+    dest.tv_sec = src.tv_sec; \
+    dest.tv_nsec = src.tv_nsec; } while(0);
+
+#define SPEED_NORMAL 524288
+
+typedef float (*path_func_t)(float);
+
+/* How multi_sweep() paces itself */
+typedef enum sweep_sched {
+    SWEEP_TICK, /* spin, updating every joint every pass */
+    SWEEP_EVENT, /* sleep until some joint's output count changes */
+} sweep_sched_t;
+
+typedef struct path {
+    int start_duty;
+    int target_duty;
+    float progress;
+    float last_progress;
+    float progress_unit;
+    int num_steps;
+    bool done;
+    path_func_t path_func; 
+} path_t;
+
+typedef struct node {
+    int index;
+    int min_duty;
+    int max_duty;
+    int duty;
+    int duty_default;
+    int last_duty;
+    int a;
+    int b;
+    servo_model_t model;
+    servo_est_t est;
+    servo_model_t sim_model; /* the arm DRY_RUN pretends to drive */
+    servo_est_t sim;
+    path_t *path;
+} node_t;
+
+struct cspace;
+
+/* Limits and defaults for one arm, copy before use */
+extern const node_t node_defaults[NUM_JOINTS];
+
+/* If set, multi_sweep() writes "<t_ns> <joint> <cmd> <pos>" per joint per
+ * tick, which is what calib reads. pos is the simulated arm under DRY_RUN
+ * and the model's prediction otherwise. */
+extern FILE *arm_record;
+
+/* --------------------------------------------------*/
+/* Path functions */
+/* --------------------------------------------------*/
+float gentle(float in);
+float euler_poisson(float x);
+float gentle2(float x);
+
+/* --------------------------------------------------*/
+/* Everything below talks to the device behind fd */
+/* --------------------------------------------------*/
+int path_duty(const path_t* path, float progress);
+int path_command(const node_t* node, float progress);
+int calc_next_duty(node_t* node);
+int duty_counts(const node_t* node, int duty);
+int output_duty(const node_t* node, int duty);
+int set_duty(int fd, node_t* node);
+int get_snapshot(int fd, struct servo_snapshot* snap);
+int init_nodes(int fd, node_t* nodes, int count);
+int sim_load(node_t* nodes, int count);
+int servo_sync(int fd, node_t* node);
+int sepath_t(path_t** pPath, int start_duty, int duty_goal);
+bool path_limit(path_t* path, const servo_model_t* model);
+float clock_delta(struct timespec t1, struct timespec t2);
+int get_max_delta(node_t* nodes[6], int* pMaxDelta);
+int multi_sweep(int fd, node_t *nodes[6], int duty_end[6],
+        const struct cspace *cspace, sweep_sched_t sched);
+
+#endif /* ARM_H */
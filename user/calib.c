@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "arm.h"
+#include "model.h"
+
+/* Fits a servo_model_t per joint to a recorded run.
+ *
+ * Input is what multi_sweep() writes to arm_record (ROBOT_RECORD=<file>
+ * sweep ...): "<t_ns> <joint> <cmd> <pos>" lines, with t_ns restarting at
+ * every move. Under DRY_RUN pos is the simulated arm described by the
+ * ROBOT_SIM_MODEL file; on hardware it is only the prediction, so replace
+ * it with measured horn positions (in duty ns) before fitting.
+ *
+ * Output is the model file read by model_load(). */
+
+/* Fitting runs at this resolution, which is also the model's */
+#define RESAMPLE_NS MODEL_SAMPLE_NS
+#define DEAD_STEP_NS 1000000
+#define ROUNDS 6
+
+typedef struct sample {
+    double t_ns;
+    int cmd;
+    float pos;
+    bool first; /* start of a move */
+} sample_t;
+
+typedef struct joint_log {
+    sample_t *s;
+    int count;
+    int size;
+    double last_t;
+} joint_log_t;
+
+static joint_log_t g_log[NUM_JOINTS];
+
+/* --------------------------------------------------*/
+/* Function definitions */
+/* --------------------------------------------------*/
+int log_add(
+        joint_log_t *log,
+        double t_ns,
+        int cmd,
+        float pos)
+{
+    bool first = log->count == 0 || t_ns < log->last_t;
+
+    /* Only keep one sample per RESAMPLE_NS, the newest wins */
+    if (!first && log->count && t_ns - log->s[log->count - 1].t_ns < RESAMPLE_NS) {
+        log->s[log->count - 1].cmd = cmd;
+        log->s[log->count - 1].pos = pos;
+        log->last_t = t_ns;
+        return 0;
+    }
+
+    if (log->count == log->size) {
+        int size = log->size ? 2 * log->size : 1024;
+        sample_t *s = realloc(log->s, size * sizeof(*s));
+        if (!s) return -ENOMEM;
+        log->s = s;
+        log->size = size;
+    }
+
+    log->s[log->count++] = (sample_t){ .t_ns = t_ns, .cmd = cmd, .pos = pos, .first = first };
+    log->last_t = t_ns;
+    return 0;
+}
+
+/* Sum of squared position errors replaying the log through model */
+double cost(
+        const servo_model_t *model,
+        const joint_log_t *log)
+{
+    servo_est_t est;
+    double sum = 0;
+
+    for (int i = 0; i < log->count; i++) {
+        const sample_t *s = &log->s[i];
+
+        if (s->first) {
+            model_reset(&est, s->pos);
+            continue;
+        }
+
+        model_step(model, &est, s->cmd, s->t_ns - log->s[i - 1].t_ns);
+        double err = est.pos - s->pos;
+        sum += err * err;
+    }
+    return sum;
+}
+
+/* Fastest the recorded horn ever moved. Only a lower bound on max_rate:
+ * unless the run actually hit the limit the real cap is higher. */
+float observed_rate(
+        const joint_log_t *log)
+{
+    float rate = 0;
+
+    for (int i = 1; i < log->count; i++) {
+        if (log->s[i].first) continue;
+        float dt = (log->s[i].t_ns - log->s[i - 1].t_ns) / 1E9f;
+        if (dt <= 0) continue;
+        float v = fabsf(log->s[i].pos - log->s[i - 1].pos) / dt;
+        if (v > rate) rate = v;
+    }
+    return rate;
+}
+
+/* Coordinate descent: dead time by exhaustive search, rates by shrinking
+ * multiplicative steps */
+double fit(
+        const joint_log_t *log,
+        servo_model_t *model)
+{
+    static const float factors[] = { 0.5f, 0.7f, 0.85f, 1.18f, 1.4f, 2.0f };
+    double best = cost(model, log);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        servo_model_t m = *model;
+        for (m.dead_ns = 0; m.dead_ns < MODEL_HISTORY * MODEL_SAMPLE_NS; m.dead_ns += DEAD_STEP_NS) {
+            double c = cost(&m, log);
+            if (c < best) {
+                best = c;
+                model->dead_ns = m.dead_ns;
+            }
+        }
+
+        /* Later rounds take smaller steps */
+        float shrink = 1.0f / (1 + round);
+        for (int f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+            float k = 1 + (factors[f] - 1) * shrink;
+
+            m = *model;
+            m.max_rate *= k;
+            double c = cost(&m, log);
+            if (c < best) {
+                best = c;
+                *model = m;
+            }
+
+            m = *model;
+            m.max_accel *= k;
+            c = cost(&m, log);
+            if (c < best) {
+                best = c;
+                *model = m;
+            }
+        }
+    }
+
+    return best;
+}
+
+int main(int argc, char** argv) {
+    char line[128];
+    FILE *f = stdin;
+
+    if (argc > 2) {
+        pr("usage: %s [<recording>] > model.txt", argv[0]);
+        return 0;
+    }
+    if (argc == 2 && NULL == (f = fopen(argv[1], "r"))) {
+        pr("Error %d opening %s: %s", errno, argv[1], strerror(errno));
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        double t_ns;
+        int joint, cmd;
+        float pos;
+
+        if (4 != sscanf(line, "%lf %d %d %f", &t_ns, &joint, &cmd, &pos) ||
+                joint < 0 || joint >= NUM_JOINTS) {
+            continue;
+        }
+        if (0 != log_add(&g_log[joint], t_ns, cmd, pos)) {
+            pr("out of memory");
+            return 1;
+        }
+    }
+    if (f != stdin) fclose(f);
+
+    printf("# joint dead_ns max_rate max_accel\n");
+    for (int j = 0; j < NUM_JOINTS; j++) {
+        joint_log_t *log = &g_log[j];
+        if (log->count < 2) continue;
+
+        servo_model_t model = node_defaults[j].model;
+        float rate = observed_rate(log);
+        if (rate <= 0) {
+            pr("joint %d never moved, nothing to fit", j);
+            free(log->s);
+            continue;
+        }
+        /* A cap the run never reached can't be fitted from it, and the
+         * search only steps multiplicatively, so never start below what
+         * was plainly possible */
+        if (rate > model.max_rate) {
+            model.max_rate = rate;
+        }
+
+        double err = fit(log, &model);
+        printf("%d %d %.0f %.0f\n", j, model.dead_ns, model.max_rate, model.max_accel);
+        pr("joint %d: %d samples, rms error %.0f ns", j, log->count, sqrt(err / log->count));
+        free(log->s);
+    }
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h> /* struct timespec and nanosleep */
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "arm.h"
+#include "cspace.h"
+
+/* Drives several arms at once, one pinned control-loop thread per device.
+ *
+ * The main thread is the planner: it reads moves from stdin and hands them
+ * to each arm through its own single-producer/single-consumer queue. Arm
+ * threads own their fd and node table outright, so nothing shared is
+ * touched while a move is running (the collision map is read-only and
+ * shared). Moves addressed to "all" are coordinated: every arm waits on a
+ * barrier before starting it.
+ *
+ * stdin, one move per line:
+ *     <arm> <duty0> <duty1> <duty2> <duty3> <duty4> <duty5>
+ *     all <duty0> <duty1> <duty2> <duty3> <duty4> <duty5>
+ */
+
+#define MAX_ARMS 4
+#define QUEUE_LEN 64 /* must be a power of two */
+#define CACHELINE 64
+#define IDLE_NS 1000000
+
+typedef enum move_kind {
+    MOVE_SINGLE,
+    MOVE_SYNC,
+    MOVE_QUIT,
+} move_kind_t;
+
+typedef struct move {
+    move_kind_t kind;
+    int duty_end[NUM_JOINTS];
+} move_t;
+
+/* Planner only writes head, arm thread only writes tail */
+typedef struct move_queue {
+    _Alignas(CACHELINE) atomic_uint head;
+    _Alignas(CACHELINE) atomic_uint tail;
+    _Alignas(CACHELINE) move_t slot[QUEUE_LEN];
+} move_queue_t;
+
+typedef struct arm {
+    int id;
+    int cpu;
+    const char *path;
+    int fd;
+    node_t node[NUM_JOINTS];
+    move_queue_t queue;
+    pthread_t thread;
+} arm_t;
+
+static arm_t g_arm[MAX_ARMS];
+static int g_num_arms;
+static pthread_barrier_t g_barrier;
+static cspace_t g_cspace;
+static const cspace_t *g_pCspace;
+static sweep_sched_t g_sched = SWEEP_TICK;
+
+/* --------------------------------------------------*/
+/* Function definitions */
+/* --------------------------------------------------*/
+bool queue_push(
+        move_queue_t *q,
+        const move_t *move)
+{
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (head - tail >= QUEUE_LEN) return false;
+
+    q->slot[head & (QUEUE_LEN - 1)] = *move;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool queue_pop(
+        move_queue_t *q,
+        move_t *move)
+{
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if (head == tail) return false;
+
+    *move = q->slot[tail & (QUEUE_LEN - 1)];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+int pin_to_cpu(
+        pthread_t thread,
+        int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return -pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+void *arm_loop(void *param)
+{
+    arm_t *arm = param;
+    struct timespec idle = { .tv_sec = 0, .tv_nsec = IDLE_NS };
+    node_t *nodes[NUM_JOINTS];
+    move_t move;
+    int ret;
+
+    if (0 != (ret = pin_to_cpu(pthread_self(), arm->cpu))) {
+        pr("arm %d: error %d pinning to cpu %d: %s",
+                arm->id, -ret, arm->cpu, strerror(-ret));
+    }
+
+    for (int i = 0; i < NUM_JOINTS; i++) {
+        nodes[i] = &arm->node[i];
+    }
+
+    for (;;) {
+        if (!queue_pop(&arm->queue, &move)) {
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        if (move.kind == MOVE_QUIT) break;
+
+        if (move.kind == MOVE_SYNC) {
+            pthread_barrier_wait(&g_barrier);
+        }
+
+        if (0 != (ret = multi_sweep(arm->fd, nodes, move.duty_end, g_pCspace, g_sched))) {
+            pr("arm %d: error %d sweeping: %s",
+                    arm->id, -ret, strerror(-ret));
+        }
+    }
+
+    return NULL;
+}
+
+void post(
+        arm_t *arm,
+        const move_t *move)
+{
+    struct timespec idle = { .tv_sec = 0, .tv_nsec = IDLE_NS };
+
+    while (!queue_push(&arm->queue, move)) {
+        nanosleep(&idle, NULL);
+    }
+}
+
+/* Returns 0 on success, -EINVAL on a line that doesn't parse */
+int plan(
+        const char *line)
+{
+    char target[16];
+    move_t move;
+
+    memset(&move, 0, sizeof(move));
+    if (7 != sscanf(line, "%15s %d %d %d %d %d %d", target,
+                &move.duty_end[0], &move.duty_end[1], &move.duty_end[2],
+                &move.duty_end[3], &move.duty_end[4], &move.duty_end[5])) {
+        return -EINVAL;
+    }
+
+    if (0 == strcmp(target, "all")) {
+        move.kind = MOVE_SYNC;
+        for (int i = 0; i < g_num_arms; i++) {
+            post(&g_arm[i], &move);
+        }
+        return 0;
+    }
+
+    char *end;
+    long id = strtol(target, &end, 10);
+    if (*end || id < 0 || id >= g_num_arms) {
+        return -EINVAL;
+    }
+    move.kind = MOVE_SINGLE;
+    post(&g_arm[id], &move);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int ret = 0;
+    char line[256];
+
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "e"))) {
+        switch (opt) {
+            case 'e':
+                g_sched = SWEEP_EVENT;
+                break;
+            default:
+                argc = 0;
+                break;
+        }
+    }
+
+    if (argc - optind < 1 || argc - optind > MAX_ARMS) {
+        pr("usage: %s [-e] <device> [<device> ...] (up to %d), moves on stdin", argv[0], MAX_ARMS);
+        pr("  -e  only wake up when a joint's output would change");
+        return 0;
+    }
+    g_num_arms = argc - optind;
+
+    /* Core 0 is left to the planner, arms take the rest in turn */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    pin_to_cpu(pthread_self(), 0);
+
+    if (0 != (ret = cspace_open(&g_cspace, CSPACE_PATH))) {
+        pr("No collision map at %s (%s), moves are unchecked",
+                CSPACE_PATH, strerror(-ret));
+        ret = 0;
+    } else {
+        g_pCspace = &g_cspace;
+    }
+
+    if (0 != (ret = -pthread_barrier_init(&g_barrier, NULL, g_num_arms))) {
+        pr("Error %d creating barrier: %s", -ret, strerror(-ret));
+        return 1;
+    }
+
+    int started = 0;
+    for (int i = 0; i < g_num_arms; i++) {
+        arm_t *arm = &g_arm[i];
+
+        arm->id = i;
+        arm->cpu = cpus > 1 ? 1 + i % (cpus - 1) : 0;
+        arm->path = argv[optind + i];
+        memcpy(arm->node, node_defaults, sizeof(arm->node));
+        if (0 != (ret = model_load(MODEL_PATH, arm->node, NUM_JOINTS)) && ret != -ENOENT) {
+            pr("arm %d: error %d loading %s: %s", i, -ret, MODEL_PATH, strerror(-ret));
+        }
+        sim_load(arm->node, NUM_JOINTS);
+        ret = 0;
+
+        if (0 > (arm->fd = open(arm->path, O_WRONLY))) {
+            ret = -errno;
+            pr("Error %d opening %s: %s",
+                    errno, arm->path, strerror(errno));
+            break;
+        }
+
+        if (0 != (ret = init_nodes(arm->fd, arm->node, NUM_JOINTS))) {
+            pr("arm %d: init_nodes returns %d: %s",
+                    i, -ret, strerror(-ret));
+        }
+
+        if (ret == 0 && 0 != (ret = -pthread_create(&arm->thread, NULL, arm_loop, arm))) {
+            pr("Error %d starting arm %d: %s", -ret, i, strerror(-ret));
+        }
+        if (ret != 0) {
+            close(arm->fd);
+            break;
+        }
+        started++;
+    }
+
+    if (ret == 0) {
+        while (fgets(line, sizeof(line), stdin)) {
+            if (line[0] == '\n' || line[0] == '#') continue;
+            if (0 != plan(line)) {
+                pr("can't parse move: %s", line);
+            }
+        }
+    }
+
+    /* Let every running arm finish what it has queued, then stop */
+    move_t quit = { .kind = MOVE_QUIT };
+    for (int i = 0; i < started; i++) {
+        post(&g_arm[i], &quit);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(g_arm[i].thread, NULL);
+        close(g_arm[i].fd);
+    }
+
+    pthread_barrier_destroy(&g_barrier);
+    cspace_close(&g_cspace);
+    return ret ? 1 : 0;
+}
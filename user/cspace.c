@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "cspace.h"
+
+/* Upper bound on samples taken along one planned move */
+#define CSPACE_MAX_SAMPLES 65536
+
+/* --------------------------------------------------*/
+/* Function definitions */
+/* --------------------------------------------------*/
+int cspace_open(
+        cspace_t *cs,
+        const char *path)
+{
+    if (!cs || !path) return -EINVAL;
+
+    int ret = 0;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    memset(cs, 0, sizeof(*cs));
+    if (fd < 0) {
+        return -errno;
+    }
+
+    if (0 != fstat(fd, &st)) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct cspace_hdr)) {
+        pr("%s is too short to be a cspace map", path);
+        close(fd);
+        return -EINVAL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        return -errno;
+    }
+
+    cs->hdr = map;
+    cs->bits = (const uint8_t *)map + sizeof(struct cspace_hdr);
+    cs->map_size = st.st_size;
+
+    const struct cspace_hdr *hdr = cs->hdr;
+    uint32_t cell_bits = 0;
+
+    if (hdr->magic != CSPACE_MAGIC || hdr->version != CSPACE_VERSION ||
+            hdr->ndims == 0 || hdr->ndims > CSPACE_MAX_DIMS) {
+        pr("%s: bad header (magic %08x version %u ndims %u)",
+                path, hdr->magic, hdr->version, hdr->ndims);
+        ret = -EINVAL;
+    }
+
+    for (uint32_t d = 0; !ret && d < hdr->ndims; d++) {
+        const struct cspace_dim *dim = &hdr->dim[d];
+
+        if (dim->joint < 0 || dim->joint >= NUM_JOINTS ||
+                dim->bits <= 0 || dim->bits > CSPACE_MAX_CELL_BITS ||
+                dim->max_duty <= dim->min_duty) {
+            pr("%s: bad dimension %u", path, d);
+            ret = -EINVAL;
+            break;
+        }
+        cell_bits += dim->bits;
+        cs->scale[d] = ((uint64_t)1 << (32 + dim->bits)) /
+            (uint64_t)(dim->max_duty - dim->min_duty + 1);
+    }
+
+    if (!ret && (cell_bits != hdr->cell_bits || cell_bits > CSPACE_MAX_CELL_BITS ||
+                cs->map_size < sizeof(struct cspace_hdr) + cspace_bitset_size(cell_bits))) {
+        pr("%s: bitset doesn't match its header", path);
+        ret = -EINVAL;
+    }
+
+    if (ret) {
+        cspace_close(cs);
+    }
+    return ret;
+}
+
+void cspace_close(
+        cspace_t *cs)
+{
+    if (cs && cs->hdr) {
+        munmap((void *)cs->hdr, cs->map_size);
+    }
+    if (cs) {
+        memset(cs, 0, sizeof(*cs));
+    }
+}
+
+/* Walk the move already set up on nodes (see sepath_t) finely enough that
+ * no covered joint skips a bin between samples. Samples are the commands
+ * multi_sweep() will send, each joint led by its own dead time.
+ * Returns 0 if the whole move is clear, -EDOM if any sample is blocked. */
+int cspace_check_path(
+        const cspace_t *cs,
+        node_t *nodes[NUM_JOINTS])
+{
+    if (!cs || !cs->hdr || !nodes) return -EINVAL;
+
+    int duty[NUM_JOINTS];
+    float duration = 0;
+    long samples = 1;
+
+    for (int n = 0; n < NUM_JOINTS; n++) {
+        duty[n] = nodes[n] ? nodes[n]->duty : 0;
+        if (!nodes[n] || !nodes[n]->path) continue;
+
+        path_t *path = nodes[n]->path;
+        if (path->progress_unit > 0 && 1.0f / path->progress_unit > duration) {
+            duration = 1.0f / path->progress_unit;
+        }
+    }
+
+    for (uint32_t d = 0; d < cs->hdr->ndims; d++) {
+        const struct cspace_dim *dim = &cs->hdr->dim[d];
+        node_t *node = nodes[dim->joint];
+        if (!node || !node->path) continue;
+
+        /* Path functions may overshoot the straight line by a little,
+         * and joints stepping together can clip the corner of a cell, so
+         * take sixteen samples per bin crossed */
+        long cells = ((long long)abs(node->path->target_duty - node->path->start_duty) << dim->bits) /
+            (dim->max_duty - dim->min_duty + 1) + 1;
+        /* ...and a joint that finishes early, or is led far ahead by its
+         * dead time, crosses them in less of the move */
+        float busy = 1.0f / node->path->progress_unit - node->model.dead_ns;
+        if (busy < 1) busy = 1;
+        float want = 16.0f * cells * duration / busy;
+        if (want > CSPACE_MAX_SAMPLES) want = CSPACE_MAX_SAMPLES;
+        if (want > samples) samples = want;
+    }
+    if (samples > CSPACE_MAX_SAMPLES) samples = CSPACE_MAX_SAMPLES;
+
+    for (long s = 0; s <= samples; s++) {
+        float t = duration * s / samples;
+
+        for (int n = 0; n < NUM_JOINTS; n++) {
+            if (!nodes[n] || !nodes[n]->path) continue;
+
+            float progress = t * nodes[n]->path->progress_unit;
+            if (progress > 1.0f) progress = 1.0f;
+            duty[n] = path_command(nodes[n], progress);
+        }
+
+        if (cspace_blocked(cs, duty)) {
+            pr("move blocked at %.1f%%", 100.0f * s / samples);
+            return -EDOM;
+        }
+    }
+
+    return 0;
+}
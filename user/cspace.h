@@ -0,0 +1,82 @@
+#ifndef CSPACE_H
+#define CSPACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "arm.h"
+
+/* Joint-space occupancy grid, built offline by cspace_build and mapped
+ * read-only at startup.
+ *
+ * Each dimension quantizes one joint's duty range into 2^bits bins; the
+ * bins are concatenated (first dimension most significant) to give a cell
+ * number, and the cell's bit in the bitset says whether that
+ * configuration is blocked. Joints not covered by a dimension (base,
+ * claw) never block anything. */
+
+#define CSPACE_MAGIC 0x43505343 /* "CSPC" */
+#define CSPACE_VERSION 1
+#define CSPACE_MAX_DIMS 4
+#define CSPACE_MAX_CELL_BITS 28
+
+#define CSPACE_PATH "/etc/robot/cspace.bin"
+
+struct cspace_dim {
+    int32_t joint;
+    int32_t min_duty;
+    int32_t max_duty;
+    int32_t bits;
+};
+
+/* On-disk header, the bitset follows immediately */
+struct cspace_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ndims;
+    uint32_t cell_bits; /* sum of dim[].bits */
+    struct cspace_dim dim[CSPACE_MAX_DIMS];
+};
+
+typedef struct cspace {
+    const struct cspace_hdr *hdr;
+    const uint8_t *bits;
+    size_t map_size;
+    /* (2^bits << 32) / span, so a bin is one multiply and a shift */
+    uint64_t scale[CSPACE_MAX_DIMS];
+} cspace_t;
+
+static inline size_t cspace_bitset_size(
+        uint32_t cell_bits)
+{
+    return (((size_t)1 << cell_bits) + 7) / 8;
+}
+
+/* Constant time: one multiply per dimension and a byte load */
+static inline bool cspace_blocked(
+        const cspace_t *cs,
+        const int duty[NUM_JOINTS])
+{
+    uint32_t cell = 0;
+
+    for (uint32_t d = 0; d < cs->hdr->ndims; d++) {
+        const struct cspace_dim *dim = &cs->hdr->dim[d];
+        int v = duty[dim->joint];
+
+        /* set_duty() clamps to the same range before anything is sent */
+        if (v < dim->min_duty) v = dim->min_duty;
+        if (v > dim->max_duty) v = dim->max_duty;
+
+        uint32_t bin = ((uint64_t)(v - dim->min_duty) * cs->scale[d]) >> 32;
+        cell = (cell << dim->bits) | bin;
+    }
+
+    return (cs->bits[cell >> 3] >> (cell & 7)) & 1;
+}
+
+int cspace_open(cspace_t *cs, const char *path);
+void cspace_close(cspace_t *cs);
+int cspace_check_path(const cspace_t *cs, node_t *nodes[NUM_JOINTS]);
+
+#endif /* CSPACE_H */
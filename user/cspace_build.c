@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+#include <limits.h> /* PATH_MAX */
+
+#include "arm.h"
+#include "cspace.h"
+
+/* Offline builder for the collision map read by cspace_open().
+ *
+ * Shoulder, elbow and wrist1 all pitch in the same vertical plane, so the
+ * arm is modelled as three capsules in that plane above a cylindrical base
+ * column. wrist2 only rolls the hand and the base only turns the whole
+ * plane, so neither can cause a self-collision and they get no dimension.
+ * Each cell is tested at its centre; the link radii carry the margin. */
+
+/* Geometry in mm, measure your own arm */
+#define BASE_HEIGHT 70.0f
+#define BASE_RADIUS 50.0f
+#define UPPER_ARM 105.0f
+#define FOREARM 98.0f
+#define HAND 150.0f
+#define LINK_RADIUS 20.0f
+#define GROUND_MARGIN 10.0f
+
+#define DEF_BITS 7
+
+static const int dim_joints[] = { 1, 2, 3 }; /* shoulder, elbow, wrist1 */
+#define NUM_DIMS ((int)(sizeof(dim_joints) / sizeof(dim_joints[0])))
+
+typedef struct pt {
+    float x;
+    float z;
+} pt_t;
+
+/* --------------------------------------------------*/
+/* Function definitions */
+/* --------------------------------------------------*/
+/* Radians away from the middle of the joint's travel */
+float duty_to_rad(
+        const node_t *node,
+        int duty)
+{
+    int centre = (node->min_duty + node->max_duty) / 2;
+    return (float)(duty - centre) / node->a * (float)M_PI / 180.0f;
+}
+
+float pt_seg_dist(
+        pt_t p,
+        pt_t a,
+        pt_t b)
+{
+    float dx = b.x - a.x, dz = b.z - a.z;
+    float len2 = dx * dx + dz * dz;
+    float t = len2 > 0 ? ((p.x - a.x) * dx + (p.z - a.z) * dz) / len2 : 0;
+
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+    return hypotf(p.x - (a.x + t * dx), p.z - (a.z + t * dz));
+}
+
+float cross(pt_t o, pt_t a, pt_t b)
+{
+    return (a.x - o.x) * (b.z - o.z) - (a.z - o.z) * (b.x - o.x);
+}
+
+float seg_seg_dist(
+        pt_t a,
+        pt_t b,
+        pt_t c,
+        pt_t d)
+{
+    float d1 = cross(a, b, c), d2 = cross(a, b, d);
+    float d3 = cross(c, d, a), d4 = cross(c, d, b);
+
+    if (((d1 > 0) != (d2 > 0)) && ((d3 > 0) != (d4 > 0))) {
+        return 0;
+    }
+
+    float m = pt_seg_dist(a, c, d);
+    m = fminf(m, pt_seg_dist(b, c, d));
+    m = fminf(m, pt_seg_dist(c, a, b));
+    m = fminf(m, pt_seg_dist(d, a, b));
+    return m;
+}
+
+/* Angles are relative to the previous link, 0 is straight up */
+bool blocked(
+        float shoulder,
+        float elbow,
+        float wrist)
+{
+    pt_t base = { 0, 0 };
+    pt_t s = { 0, BASE_HEIGHT };
+    float a = shoulder;
+    pt_t e = { s.x + UPPER_ARM * sinf(a), s.z + UPPER_ARM * cosf(a) };
+    a += elbow;
+    pt_t w = { e.x + FOREARM * sinf(a), e.z + FOREARM * cosf(a) };
+    a += wrist;
+    pt_t t = { w.x + HAND * sinf(a), w.z + HAND * cosf(a) };
+
+    /* Into the table */
+    if (e.z < LINK_RADIUS + GROUND_MARGIN ||
+            w.z < LINK_RADIUS + GROUND_MARGIN ||
+            t.z < GROUND_MARGIN) {
+        return true;
+    }
+
+    /* Forearm or hand into the base column */
+    if (seg_seg_dist(e, w, base, s) < BASE_RADIUS + LINK_RADIUS ||
+            seg_seg_dist(w, t, base, s) < BASE_RADIUS + LINK_RADIUS) {
+        return true;
+    }
+
+    /* Hand folded back onto the upper arm */
+    if (seg_seg_dist(w, t, s, e) < 2 * LINK_RADIUS) {
+        return true;
+    }
+
+    return false;
+}
+
+int main(int argc, char** argv) {
+    const char *out = CSPACE_PATH;
+    int bits = DEF_BITS;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "o:b:"))) {
+        switch (opt) {
+            case 'o':
+                out = optarg;
+                break;
+            case 'b':
+                bits = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                pr("usage: %s [-o <file>] [-b <bits per joint>]", argv[0]);
+                return 0;
+        }
+    }
+
+    if (bits < 1 || bits * NUM_DIMS > CSPACE_MAX_CELL_BITS) {
+        pr("bits per joint must be 1..%d", CSPACE_MAX_CELL_BITS / NUM_DIMS);
+        return 1;
+    }
+
+    struct cspace_hdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CSPACE_MAGIC;
+    hdr.version = CSPACE_VERSION;
+    hdr.ndims = NUM_DIMS;
+    hdr.cell_bits = bits * NUM_DIMS;
+    for (int d = 0; d < NUM_DIMS; d++) {
+        const node_t *node = &node_defaults[dim_joints[d]];
+        hdr.dim[d].joint = dim_joints[d];
+        hdr.dim[d].min_duty = node->min_duty;
+        hdr.dim[d].max_duty = node->max_duty;
+        hdr.dim[d].bits = bits;
+    }
+
+    size_t size = cspace_bitset_size(hdr.cell_bits);
+    uint8_t *set = calloc(1, size);
+    if (!set) {
+        pr("couldn't allocate %zu bytes", size);
+        return 1;
+    }
+
+    /* Angle at the centre of every bin, per dimension */
+    int nbins = 1 << bits;
+    float *rad = malloc(NUM_DIMS * nbins * sizeof(float));
+    if (!rad) {
+        pr("couldn't allocate bin table");
+        free(set);
+        return 1;
+    }
+    for (int d = 0; d < NUM_DIMS; d++) {
+        const struct cspace_dim *dim = &hdr.dim[d];
+        float width = (float)(dim->max_duty - dim->min_duty + 1) / nbins;
+        for (int i = 0; i < nbins; i++) {
+            int duty = dim->min_duty + (int)((i + 0.5f) * width);
+            rad[d * nbins + i] = duty_to_rad(&node_defaults[dim->joint], duty);
+        }
+    }
+
+    long count = 0;
+    for (uint32_t cell = 0; cell < (1u << hdr.cell_bits); cell++) {
+        int i0 = (cell >> (2 * bits)) & (nbins - 1);
+        int i1 = (cell >> bits) & (nbins - 1);
+        int i2 = cell & (nbins - 1);
+
+        if (blocked(rad[i0], rad[nbins + i1], rad[2 * nbins + i2])) {
+            set[cell >> 3] |= 1 << (cell & 7);
+            count++;
+        }
+    }
+
+    /* sweep and coord may have the old map mapped; replace it whole
+     * rather than truncating it under them */
+    char tmp[PATH_MAX];
+    if ((int)sizeof(tmp) <= snprintf(tmp, sizeof(tmp), "%s.tmp", out)) {
+        pr("%s: path too long", out);
+        free(rad);
+        free(set);
+        return 1;
+    }
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        pr("Error %d opening %s: %s", errno, tmp, strerror(errno));
+        free(rad);
+        free(set);
+        return 1;
+    }
+    int ret = 0;
+    if (1 != fwrite(&hdr, sizeof(hdr), 1, f) || 1 != fwrite(set, size, 1, f)) {
+        pr("Error writing %s", tmp);
+        ret = 1;
+    }
+    if (0 != fclose(f)) {
+        pr("Error %d closing %s: %s", errno, tmp, strerror(errno));
+        ret = 1;
+    }
+    if (ret == 0 && 0 != rename(tmp, out)) {
+        pr("Error %d renaming %s to %s: %s", errno, tmp, out, strerror(errno));
+        ret = 1;
+    }
+    if (ret != 0) {
+        unlink(tmp);
+        free(rad);
+        free(set);
+        return ret;
+    }
+
+    pr("wrote %s: %u cells, %ld blocked (%.1f%%), %zu bytes",
+            out, 1u << hdr.cell_bits, count,
+            100.0 * count / (1u << hdr.cell_bits), sizeof(hdr) + size);
+
+    free(rad);
+    free(set);
+    return ret;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "arm.h"
+#include "model.h"
+
+/* Longest a settle prediction will look ahead */
+#define MODEL_SETTLE_MAX_NS 5000000000.0f
+#define MODEL_SETTLE_STEP_NS 1000000.0f
+
+/* --------------------------------------------------*/
+/* Function definitions */
+/* --------------------------------------------------*/
+void model_reset(
+        servo_est_t *est,
+        int duty)
+{
+    memset(est, 0, sizeof(*est));
+    est->pos = duty;
+    est->hist[0].cmd = duty;
+    est->count = 1;
+    /* so the first command gets its own slot */
+    est->last_sample_ns = -MODEL_SAMPLE_NS;
+}
+
+/* Newest command at least dead_ns old, or the oldest one we still have */
+static int delayed_cmd(
+        const servo_est_t *est,
+        int dead_ns)
+{
+    int64_t when = est->t_ns - dead_ns;
+    int newest = est->count - 1;
+    int oldest = est->count > MODEL_HISTORY ? est->count - MODEL_HISTORY : 0;
+
+    for (int i = newest; i > oldest; i--) {
+        if (est->hist[i % MODEL_HISTORY].t_ns <= when) {
+            return est->hist[i % MODEL_HISTORY].cmd;
+        }
+    }
+    return est->hist[oldest % MODEL_HISTORY].cmd;
+}
+
+static void advance(
+        const servo_model_t *model,
+        servo_est_t *est,
+        int64_t dt_ns)
+{
+    est->t_ns += dt_ns;
+
+    float dt = dt_ns / 1E9f;
+    float err = delayed_cmd(est, model->dead_ns) - est->pos;
+
+    /* Fastest speed we can still brake from in time, capped by max_rate */
+    float want = sqrtf(2 * model->max_accel * fabsf(err));
+    if (want > model->max_rate) want = model->max_rate;
+    if (err < 0) want = -want;
+
+    float dv = model->max_accel * dt;
+    if (want > est->vel + dv) want = est->vel + dv;
+    if (want < est->vel - dv) want = est->vel - dv;
+    est->vel = want;
+
+    /* Don't step over the command when dt is coarse */
+    float step = est->vel * dt;
+    if (fabsf(step) > fabsf(err)) {
+        step = err;
+        est->vel = 0;
+    }
+    est->pos += step;
+}
+
+/* Advance the model by dt_ns (in sample-sized steps, so a loop that sleeps
+ * between updates gets the same answer as one that spins), then take cmd
+ * as the command from now on */
+void model_step(
+        const servo_model_t *model,
+        servo_est_t *est,
+        int cmd,
+        float dt_ns)
+{
+    /* Model time stays in whole ns; summing float ticks into it drifts */
+    int64_t left = llroundf(dt_ns);
+
+    while (left > 0) {
+        int64_t h = left < MODEL_SAMPLE_NS ? left : MODEL_SAMPLE_NS;
+        advance(model, est, h);
+        left -= h;
+    }
+
+    /* Keep one command per sample period, the newest one wins */
+    int last = (est->count - 1) % MODEL_HISTORY;
+    if (est->t_ns - est->last_sample_ns >= MODEL_SAMPLE_NS) {
+        last = est->count++ % MODEL_HISTORY;
+        est->last_sample_ns = est->t_ns;
+        est->hist[last].t_ns = est->t_ns;
+    }
+    est->hist[last].cmd = cmd;
+}
+
+/* How much longer until the horn reaches target if the
+ * command stays at target from now on */
+float model_settle_ns(
+        const servo_model_t *model,
+        const servo_est_t *est,
+        int target)
+{
+    servo_est_t sim;
+    float t = 0;
+
+    memcpy(&sim, est, sizeof(sim));
+
+    while (t < MODEL_SETTLE_MAX_NS &&
+            (fabsf(sim.pos - target) > 1 || fabsf(sim.vel) > 0)) {
+        model_step(model, &sim, target, MODEL_SETTLE_STEP_NS);
+        t += MODEL_SETTLE_STEP_NS;
+    }
+    return t;
+}
+
+/* Reads "<joint> <dead_ns> <max_rate> <max_accel>" lines as written by
+ * calib into either the control model or the simulated arm; joints not
+ * mentioned keep their defaults. */
+static int load(
+        const char *path,
+        node_t *nodes,
+        int count,
+        bool sim)
+{
+    char line[128];
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        return -errno;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        servo_model_t model;
+        int joint;
+
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (4 != sscanf(line, "%d %d %f %f", &joint,
+                    &model.dead_ns, &model.max_rate, &model.max_accel)) {
+            pr("%s: can't parse: %s", path, line);
+            continue;
+        }
+        if (model.dead_ns < 0 || model.dead_ns >= MODEL_HISTORY * MODEL_SAMPLE_NS ||
+                model.max_rate <= 0 || model.max_accel <= 0) {
+            pr("%s: joint %d out of range, ignored", path, joint);
+            continue;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (nodes[i].index != joint) continue;
+            if (sim) {
+                nodes[i].sim_model = model;
+            } else {
+                nodes[i].model = model;
+            }
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int model_load(
+        const char *path,
+        node_t *nodes,
+        int count)
+{
+    return load(path, nodes, count, false);
+}
+
+int model_load_sim(
+        const char *path,
+        node_t *nodes,
+        int count)
+{
+    return load(path, nodes, count, true);
+}
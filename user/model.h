@@ -0,0 +1,52 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <stdint.h>
+
+/* Response model of one hobby servo: nothing happens for dead_ns after a
+ * command changes, then the horn chases the (delayed) command with its
+ * speed capped at max_rate and its speed changes capped at max_accel.
+ * Rates are in duty ns per second so they line up with node_t duties. */
+
+#define MODEL_PATH "/etc/robot/model.txt"
+
+/* Under DRY_RUN, a model file in this format describing the simulated arm.
+ * It is deliberately separate from MODEL_PATH so calib has something real
+ * to fit against. */
+#define MODEL_SIM_ENV "ROBOT_SIM_MODEL"
+
+/* Commands are kept at this spacing, which bounds how long a dead time
+ * can be modelled: MODEL_HISTORY * MODEL_SAMPLE_NS */
+#define MODEL_SAMPLE_NS 1000000
+#define MODEL_HISTORY 256
+
+#define MODEL_DEFAULT { .dead_ns = 25000000, .max_rate = 6.0e6f, .max_accel = 8.0e7f }
+
+typedef struct servo_model {
+    int dead_ns;
+    float max_rate;
+    float max_accel;
+} servo_model_t;
+
+/* Where the model thinks the horn is */
+typedef struct servo_est {
+    float pos;
+    float vel;
+    int64_t t_ns; /* since model_reset() */
+    int64_t last_sample_ns;
+    int count;
+    struct {
+        int64_t t_ns;
+        int cmd;
+    } hist[MODEL_HISTORY];
+} servo_est_t;
+
+void model_reset(servo_est_t *est, int duty);
+void model_step(const servo_model_t *model, servo_est_t *est, int cmd, float dt_ns);
+float model_settle_ns(const servo_model_t *model, const servo_est_t *est, int target);
+
+struct node;
+int model_load(const char *path, struct node *nodes, int count);
+int model_load_sim(const char *path, struct node *nodes, int count);
+
+#endif /* MODEL_H */
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../kernel/servo.h"
+
+#define pr(fmt, ...) fprintf(stderr, "<%s:%d> " fmt "\n", __func__, __LINE__, ##__VA_ARGS__)
+
+/* Carries the driver's per-joint state across a module reload:
+ *     state save <file>      before rmmod
+ *     state restore <file>   after insmod
+ */
+
+const char *path = "/dev/robot";
+
+int save(int fd, const char *file)
+{
+    struct servo_snapshot snap;
+    int ret = 0;
+
+    if (0 != ioctl(fd, SERVO_IOC_SNAPSHOT, &snap)) {
+        pr("Error %d calling snapshot ioctl: %s", errno, strerror(errno));
+        return -errno;
+    }
+
+    FILE *f = fopen(file, "wb");
+    if (!f) {
+        pr("Error %d opening %s: %s", errno, file, strerror(errno));
+        return -errno;
+    }
+    if (1 != fwrite(&snap, sizeof(snap), 1, f)) {
+        pr("Error writing %s", file);
+        ret = -EIO;
+    }
+    fclose(f);
+    return ret;
+}
+
+int restore(int fd, const char *file)
+{
+    struct servo_snapshot snap;
+
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        pr("Error %d opening %s: %s", errno, file, strerror(errno));
+        return -errno;
+    }
+    size_t got = fread(&snap, sizeof(snap), 1, f);
+    fclose(f);
+    if (1 != got) {
+        pr("%s is not a snapshot", file);
+        return -EINVAL;
+    }
+
+    if (0 != ioctl(fd, SERVO_IOC_RESTORE, &snap)) {
+        pr("Error %d calling restore ioctl: %s", errno, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int ret;
+
+    if (argc != 3 || (strcmp(argv[1], "save") && strcmp(argv[1], "restore"))) {
+        pr("usage: %s save|restore <file>", argv[0]);
+        return 0;
+    }
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        pr("Error %d opening %s: %s",
+                errno, path, strerror(errno));
+        return 1;
+    }
+
+    if (0 == strcmp(argv[1], "save")) {
+        ret = save(fd, argv[2]);
+    } else {
+        ret = restore(fd, argv[2]);
+    }
+
+    close(fd);
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h> /* struct timespec and nanosleep */
+
+#include "../kernel/servo.h"
+
+#define pr(fmt, ...) fprintf(stderr, "<%s:%d> " fmt "\n", __func__, __LINE__, ##__VA_ARGS__)
+
+/* How long to sleep when the ring is empty */
+#define POLL_NS 1000000
+
+const char *path = "/dev/robot";
+
+static const char *op_names[] = {
+    [SERVO_TELEM_SYNC] = "sync",
+    [SERVO_TELEM_ENABLE] = "enable",
+    [SERVO_TELEM_DISABLE] = "disable",
+    [SERVO_TELEM_RESTORE] = "restore",
+};
+
+void print_rec(const struct servo_telem_rec *rec)
+{
+    const char *op = rec->op < sizeof(op_names) / sizeof(op_names[0]) ?
+        op_names[rec->op] : "?";
+
+    printf("%llu.%09llu %u %s duty=%d enabled=%u result=%d\n",
+            (unsigned long long)(rec->ts_ns / 1000000000ULL),
+            (unsigned long long)(rec->ts_ns % 1000000000ULL),
+            rec->idx, op, rec->duty_ns, rec->enabled, rec->result);
+}
+
+/* Copy out everything between *pTail and the current head.
+ * Returns the number of records printed, never makes a syscall. */
+int drain(
+        const struct servo_telem_hdr *hdr,
+        __u32 *pTail,
+        unsigned long *pDropped)
+{
+    const struct servo_telem_rec *recs = (const void *)((const char *)hdr + SERVO_TELEM_HDR_SIZE);
+    static struct servo_telem_rec copy[SERVO_TELEM_NRECS];
+    __u32 tail = *pTail;
+    __u32 head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    __u32 count;
+
+    if (head - tail > SERVO_TELEM_NRECS) {
+        *pDropped += head - tail - SERVO_TELEM_NRECS;
+        tail = head - SERVO_TELEM_NRECS;
+    }
+    count = head - tail;
+
+    for (__u32 i = 0; i < count; i++) {
+        copy[i] = recs[(tail + i) & (SERVO_TELEM_NRECS - 1)];
+    }
+
+    /* Anything the driver lapped while we were copying is garbage */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    __u32 now = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+
+    int printed = 0;
+    for (__u32 i = 0; i < count; i++) {
+        if (now - (tail + i) >= SERVO_TELEM_NRECS) {
+            (*pDropped)++;
+            continue;
+        }
+        print_rec(&copy[i]);
+        printed++;
+    }
+
+    *pTail = head;
+    return printed;
+}
+
+int main(int argc, char** argv) {
+    bool follow = false;
+    bool from_start = false;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "fa"))) {
+        switch (opt) {
+            case 'f':
+                follow = true;
+                break;
+            case 'a':
+                from_start = true;
+                break;
+            default:
+                pr("usage: %s [-f] [-a]", argv[0]);
+                pr("  -f  keep draining until interrupted");
+                pr("  -a  start from the oldest record still in the ring");
+                return 0;
+        }
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        pr("Error %d opening %s: %s",
+                errno, path, strerror(errno));
+        return 1;
+    }
+
+    const struct servo_telem_hdr *hdr = mmap(NULL, SERVO_TELEM_MAP_SIZE,
+            PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == hdr) {
+        pr("Error %d mapping %s: %s",
+                errno, path, strerror(errno));
+        return 1;
+    }
+
+    if (hdr->magic != SERVO_TELEM_MAGIC ||
+            hdr->version != SERVO_TELEM_VERSION ||
+            hdr->rec_size != sizeof(struct servo_telem_rec) ||
+            hdr->nrecs != SERVO_TELEM_NRECS) {
+        pr("telemetry layout mismatch (magic %08x version %u), rebuild against servo.h",
+                hdr->magic, hdr->version);
+        munmap((void *)hdr, SERVO_TELEM_MAP_SIZE);
+        return 1;
+    }
+
+    __u32 tail = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    if (from_start) {
+        tail = tail > SERVO_TELEM_NRECS ? tail - SERVO_TELEM_NRECS : 0;
+    }
+    unsigned long dropped = 0;
+    struct timespec poll = { .tv_sec = 0, .tv_nsec = POLL_NS };
+
+    do {
+        if (0 == drain(hdr, &tail, &dropped) && follow) {
+            fflush(stdout);
+            nanosleep(&poll, NULL);
+        }
+    } while (follow);
+
+    if (dropped) {
+        pr("dropped %lu records", dropped);
+    }
+
+    munmap((void *)hdr, SERVO_TELEM_MAP_SIZE);
+    return 0;
+}